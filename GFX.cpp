@@ -1,4 +1,5 @@
 #include "GFX.hpp"
+#include <stdio.h>
 
 namespace {
 
@@ -8,10 +9,252 @@ namespace {
 	    a = b;
 	    b = tmp;
 	}
+
+	// Format value/10^decimals into out (room for 13 chars), returns the text length
+	static uint8_t formatFixed(char *out, int32_t value, uint8_t decimals)
+	{
+		char digits[12];
+		uint8_t count = 0;
+		uint8_t len = 0;
+		uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+
+		if(decimals > 9) decimals = 9;
+
+		do
+		{
+			digits[count++] = '0' + magnitude % 10;
+			magnitude /= 10;
+		} while(magnitude || (count <= decimals));
+
+		if(value < 0) out[len++] = '-';
+		while(count)
+		{
+			if(count == decimals) out[len++] = '.';
+			out[len++] = digits[--count];
+		}
+		out[len] = 0;
+
+		return len;
+	}
+
+	const uint8_t bayer8x8[8][8] = {
+		{  0, 32,  8, 40,  2, 34, 10, 42 },
+		{ 48, 16, 56, 24, 50, 18, 58, 26 },
+		{ 12, 44,  4, 36, 14, 46,  6, 38 },
+		{ 60, 28, 52, 20, 62, 30, 54, 22 },
+		{  3, 35, 11, 43,  1, 33,  9, 41 },
+		{ 51, 19, 59, 27, 49, 17, 57, 25 },
+		{ 15, 47,  7, 39, 13, 45,  5, 37 },
+		{ 63, 31, 55, 23, 61, 29, 53, 21 }
+	};
+
+	// Compare four 7-bit lanes at once, return bit i set when lane i of value >= lane i of threshold
+	inline static uint8_t thresholdLanes(uint32_t value, uint32_t threshold)
+	{
+		uint32_t ge = ((((value >> 1) & 0x7F7F7F7F) | 0x80808080) - threshold) & 0x80808080;
+		return ((ge >> 7) * 0x01020408) >> 24;
+	}
 	
 };
 
 
+/**
+ * Create text field
+ *
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param y position from the top edge (0, MAX HEIGHT)
+ * @param length field width in characters (up to GFX_FIELD_MAX)
+ * @param alignment align::LEFT or align::RIGHT
+ * @param color colors::BLACK, colors::WHITE or colors::INVERSE
+ */
+TextField::TextField(int x, int y, uint8_t length, align alignment, colors color) : x(x), y(y), length(length), alignment(alignment), color(color)
+{
+	if(this->length > GFX_FIELD_MAX) this->length = GFX_FIELD_MAX;
+	this->reset();
+}
+
+
+/**
+ * @brief Forget what is on the screen, the next draw repaints every character.
+ * Call it after the field area was overwritten, e.g. by clear() or saveBackground() of a new screen.
+ * restoreBackground() does not need it, fields keep their characters in the background layer.
+ */
+void TextField::reset()
+{
+	memset(this->glyphs, 0, sizeof(this->glyphs));
+}
+
+
+/**
+ * Create sprite
+ *
+ * @param image page packed bitmap, width bytes for every 8 rows
+ * @param mask page packed transparency mask of the same size, set bits are drawn, nullptr draws the whole rectangle
+ * @param width sprite width
+ * @param height sprite height
+ */
+Sprite::Sprite(const uint8_t* image, const uint8_t* mask, uint8_t width, uint8_t height) : image(image), mask(mask), width(width), height(height)
+{
+	for(uint8_t i=0; i<8; i++) this->shifted[i] = nullptr;
+
+	this->saved = new uint8_t[this->width * ((this->height + 7) / 8 + 1)];
+	this->x = 0;
+	this->y = 0;
+	this->visible = false;
+}
+
+
+Sprite::~Sprite()
+{
+	for(uint8_t i=0; i<8; i++) delete[] this->shifted[i];
+	delete[] this->saved;
+}
+
+
+/**
+ * @brief Number of pages covered by the sprite moved down by shift rows.
+ */
+uint8_t Sprite::shiftedPages(uint8_t shift)
+{
+	return (this->height + shift + 7) / 8;
+}
+
+
+/**
+ * @brief Get image and mask moved down by shift rows, built on first use.
+ *
+ * @param shift row offset within a page (0, 7)
+ * @return shiftedPages(shift) pages of masked image followed by the same number of pages of mask
+ */
+const uint8_t* Sprite::getShifted(uint8_t shift)
+{
+	if(this->shifted[shift] != nullptr) return this->shifted[shift];
+
+	uint8_t pages = (this->height + 7) / 8;
+	uint8_t out_pages = this->shiftedPages(shift);
+	uint8_t last_rows = 0xFF >> ((8 - (this->height & 7)) & 7);
+	uint8_t *out = new uint8_t[2 * this->width * out_pages];
+
+	for(uint8_t c=0; c<this->width; c++)
+	{
+		uint8_t image_prev = 0;
+		uint8_t mask_prev = 0;
+
+		for(uint8_t q=0; q<out_pages; q++)
+		{
+			uint8_t m = 0;
+			uint8_t b = 0;
+
+			if(q < pages)
+			{
+				m = this->mask != nullptr ? this->mask[q * this->width + c] : 0xFF;
+				if(q == pages-1) m &= last_rows;
+				b = this->image[q * this->width + c] & m;
+			}
+
+			out[q * this->width + c] = (b << shift) | (image_prev >> (8 - shift));
+			out[(out_pages + q) * this->width + c] = (m << shift) | (mask_prev >> (8 - shift));
+			image_prev = b;
+			mask_prev = m;
+		}
+	}
+
+	this->shifted[shift] = out;
+	return out;
+}
+
+
+/**
+ * @brief Check if masks of two sprites overlap, comparing 4 columns at once.
+ *
+ * @param x position of this sprite from the left edge
+ * @param y position of this sprite from the top edge
+ * @param other second sprite
+ * @param other_x position of the second sprite from the left edge
+ * @param other_y position of the second sprite from the top edge
+ * @return true when at least one pixel is covered by both masks
+ */
+bool Sprite::collides(int x, int y, Sprite &other, int other_x, int other_y)
+{
+	int left = x > other_x ? x : other_x;
+	int right = x + this->width < other_x + other.width ? x + this->width : other_x + other.width;
+	if(left >= right) return false;
+
+	uint8_t pages = this->shiftedPages(y & 7);
+	uint8_t other_pages = other.shiftedPages(other_y & 7);
+	const uint8_t* mask = this->getShifted(y & 7) + pages * this->width;
+	const uint8_t* other_mask = other.getShifted(other_y & 7) + other_pages * other.width;
+
+	// floor division, pages above the screen are negative
+	int top = (y >> 3) > (other_y >> 3) ? (y >> 3) : (other_y >> 3);
+	int bottom = (y >> 3) + pages < (other_y >> 3) + other_pages ? (y >> 3) + pages : (other_y >> 3) + other_pages;
+
+	for(int page = top; page < bottom; page++)
+	{
+		const uint8_t* a = mask + (page - (y >> 3)) * this->width + (left - x);
+		const uint8_t* b = other_mask + (page - (other_y >> 3)) * other.width + (left - other_x);
+		int i = 0;
+
+		for(; i + 4 <= right - left; i += 4)
+		{
+			uint32_t word_a, word_b;
+
+			memcpy(&word_a, a + i, 4);
+			memcpy(&word_b, b + i, 4);
+			if(word_a & word_b) return true;
+		}
+
+		for(; i < right - left; i++)
+		{
+			if(a[i] & b[i]) return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ * @brief Check if two sprites drawn on the screen overlap.
+ *
+ * @param other second sprite
+ * @return true when both are visible and at least one pixel is covered by both masks
+ */
+bool Sprite::collides(Sprite &other)
+{
+	if(!this->visible || !other.visible) return false;
+
+	return this->collides(this->x, this->y, other, other.x, other.y);
+}
+
+
+/**
+ * @brief Get position of the sprite from the left edge.
+ */
+int Sprite::getX()
+{
+	return this->x;
+}
+
+
+/**
+ * @brief Get position of the sprite from the top edge.
+ */
+int Sprite::getY()
+{
+	return this->y;
+}
+
+
+/**
+ * @brief Check if the sprite is drawn on the screen.
+ */
+bool Sprite::isVisible()
+{
+	return this->visible;
+}
+
+
 /**
  * Create GFX instantion 
  *
@@ -32,7 +275,7 @@ GFX::GFX(uint16_t const DevAddr, size Size, i2c_inst_t * i2c) : SSD1306(DevAddr,
  */
 void GFX::drawChar(int x, int y, char chr, colors color)
 {
-	if(chr > 0x7E) return; // chr > '~'
+	if((chr < 0x20) || (chr > 0x7E)) return; // chr < ' ' or chr > '~'
 
 	for(uint8_t i=0; i < this->font[1]; i++ )
 	{
@@ -57,19 +300,134 @@ void GFX::drawChar(int x, int y, char chr, colors color)
  * @param str string to be written
  * @param color colors::BLACK, colors::WHITE or colors::INVERSE
  */
-void GFX::drawString(int x, int y, std::string str, colors color)
+void GFX::drawString(int x, int y, const char* str, colors color)
 {
-	int x_tmp = x;
-
-	while(str.length())
+	for(int x_tmp = x; *str; str++)
 	{
-		this->drawChar(x_tmp, y, str.front(), color);
+		this->drawChar(x_tmp, y, *str, color);
 		x_tmp += ((uint8_t)font[1]) + 1;
-		str.erase(str.begin());
 	}
 }
 
 
+/**
+ * @brief Draw string.
+ *
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param y position from the top edge (0, MAX HEIGHT)
+ * @param str string to be written
+ * @param color colors::BLACK, colors::WHITE or colors::INVERSE
+ */
+void GFX::drawString(int x, int y, const std::string &str, colors color)
+{
+	this->drawString(x, y, str.c_str(), color);
+}
+
+
+/**
+ * @brief Draw text in the field, only characters different from the previous call are repainted.
+ * With a background layer the repainted characters are also written into it, so restoreBackground()
+ * leaves the field alone and each frame touches only the characters that changed.
+ *
+ * @param field text field, text longer than the field is cut
+ * @param text text to be written
+ */
+void GFX::drawField(TextField &field, const char* text)
+{
+	char cells[GFX_FIELD_MAX];
+	uint8_t len = strnlen(text, field.length);
+	uint8_t pad = field.alignment == align::RIGHT ? field.length - len : 0;
+	uint8_t cell_w = this->font[1] + 1;
+
+	uint8_t touched_x0[8], touched_x1[8];
+
+	memset(cells, ' ', field.length);
+	memcpy(cells + pad, text, len);
+
+	// the field is kept in the background layer, so its cells need no restoring
+	memcpy(touched_x0, this->touched_x0, 8);
+	memcpy(touched_x1, this->touched_x1, 8);
+
+	for(uint8_t i=0; i<field.length; i++)
+	{
+		if(cells[i] == field.glyphs[i]) continue;
+
+		int x = field.x + i * cell_w;
+
+		if(field.color == colors::INVERSE)
+		{
+			// drawing the old glyph again takes it off
+			if(field.glyphs[i] >= 0x20) this->drawChar(x, field.y, field.glyphs[i], colors::INVERSE);
+		}
+		else
+		{
+			this->drawFillRectangle(x, field.y, cell_w, this->font[0], field.color == colors::WHITE ? colors::BLACK : colors::WHITE);
+		}
+
+		this->drawChar(x, field.y, cells[i], field.color);
+		this->keepInBackground(x, field.y, cell_w, this->font[0]);
+		field.glyphs[i] = cells[i];
+	}
+
+	memcpy(this->touched_x0, touched_x0, 8);
+	memcpy(this->touched_x1, touched_x1, 8);
+}
+
+
+/**
+ * @brief Draw integer in the field, filled with '#' when it does not fit.
+ *
+ * @param field text field
+ * @param value number to be written
+ */
+void GFX::drawNumber(TextField &field, int32_t value)
+{
+	this->drawFixed(field, value, 0);
+}
+
+
+/**
+ * @brief Draw fixed point number in the field, e.g. value 1234 with 2 decimals is written as 12.34
+ * The field is filled with '#' when the number does not fit.
+ *
+ * @param field text field
+ * @param value number multiplied by 10^decimals
+ * @param decimals digits after the decimal point (0, 9)
+ */
+void GFX::drawFixed(TextField &field, int32_t value, uint8_t decimals)
+{
+	char text[GFX_FIELD_MAX + 1];
+
+	// a cut number would look like a valid reading, show that it does not fit instead
+	if(formatFixed(text, value, decimals) > field.length)
+	{
+		memset(text, '#', field.length);
+		text[field.length] = 0;
+	}
+
+	this->drawField(field, text);
+}
+
+
+/**
+ * @brief Draw printf formatted text in the field, formatted on the stack.
+ *
+ * @param field text field
+ * @param format printf format string
+ */
+void GFX::drawPrintf(TextField &field, const char* format, ...)
+{
+	char text[GFX_FIELD_MAX + 1];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	this->drawField(field, text);
+}
+
+
 /**
  * @brief Draw empty rectangle.
  *
@@ -213,6 +571,185 @@ void GFX::drawLine(int x_start, int y_start, int x_end, int y_end, colors color)
 }
 
 
+/**
+ * @brief Draw sprite, moving it if it is already on the screen.
+ * The background under the sprite is kept, only the columns and pages covered by the old and new mask are changed.
+ * Overlapping sprites must be erased in reverse order of drawing before any of them is moved.
+ *
+ * @param sprite sprite to be drawn
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param y position from the top edge (0, MAX HEIGHT)
+ */
+void GFX::drawSprite(Sprite &sprite, int x, int y)
+{
+	if(sprite.visible) this->eraseSprite(sprite);
+
+	uint8_t pages = sprite.shiftedPages(y & 7);
+	const uint8_t* image = sprite.getShifted(y & 7);
+	const uint8_t* mask = image + pages * sprite.width;
+
+	for(uint8_t q=0; q<pages; q++)
+	{
+		int page = (y >> 3) + q;
+		if((page < 0) || (page >= this->getHeight()/8)) continue;
+
+		for(uint8_t c=0; c<sprite.width; c++)
+		{
+			uint16_t i = q * sprite.width + c;
+
+			sprite.saved[i] = this->readPage(x + c, page);
+			this->writePage(x + c, page, image[i], mask[i]);
+		}
+	}
+
+	sprite.x = x;
+	sprite.y = y;
+	sprite.visible = true;
+}
+
+
+/**
+ * @brief Remove sprite from the screen, restoring the background under it.
+ *
+ * @param sprite sprite to be removed
+ */
+void GFX::eraseSprite(Sprite &sprite)
+{
+	if(!sprite.visible) return;
+
+	uint8_t pages = sprite.shiftedPages(sprite.y & 7);
+	const uint8_t* mask = sprite.getShifted(sprite.y & 7) + pages * sprite.width;
+
+	for(uint8_t q=0; q<pages; q++)
+	{
+		int page = (sprite.y >> 3) + q;
+		if((page < 0) || (page >= this->getHeight()/8)) continue;
+
+		for(uint8_t c=0; c<sprite.width; c++)
+		{
+			uint16_t i = q * sprite.width + c;
+			this->writePage(sprite.x + c, page, sprite.saved[i], mask[i]);
+		}
+	}
+
+	sprite.visible = false;
+}
+
+
+/**
+ * @brief Draw 8-bit grayscale image converted to black and white.
+ *
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param y position from the top edge (0, MAX HEIGHT)
+ * @param image row-major array of image_w*image_h pixels, 0 is black and 255 is white
+ * @param image_w image width
+ * @param image_h image height
+ * @param w width on the screen, 0 keeps image width (image is scaled to fit)
+ * @param h height on the screen, 0 keeps image height (image is scaled to fit)
+ * @param mode dither::ORDERED (8x8 Bayer) or dither::FLOYD_STEINBERG
+ */
+void GFX::drawGrayImage(int x, int y, const uint8_t* image, uint16_t image_w, uint16_t image_h, uint16_t w, uint16_t h, dither mode)
+{
+	if(w == 0) w = image_w;
+	if(h == 0) h = image_h;
+	if((image == nullptr) || (image_w == 0) || (image_h == 0)) return;
+
+	int x0 = x < 0 ? 0 : x;
+	int y0 = y < 0 ? 0 : y;
+	int x1 = x + w > this->getWidth() ? this->getWidth() : x + w;
+	int y1 = y + h > this->getHeight() ? this->getHeight() : y + h;
+	if((x0 >= x1) || (y0 >= y1)) return;
+
+	// nearest neighbour scaling, source column and row of every visible screen pixel
+	uint16_t src_col[128];
+	const uint8_t* src_row[64];
+
+	for(int i=x0; i<x1; i++) src_col[i] = (uint32_t)(i - x) * image_w / w;
+	for(int j=y0; j<y1; j++) src_row[j] = image + ((uint32_t)(j - y) * image_h / h) * image_w;
+
+	if(mode == dither::ORDERED)
+	{
+		// thresholds of one column for rows 0-3 and 4-7 of a page, packed as bytes to compare four pixels at once
+		uint32_t threshold[8][2];
+
+		for(uint8_t i=0; i<8; i++)
+		{
+			threshold[i][0] = threshold[i][1] = 0;
+			for(uint8_t j=0; j<4; j++)
+			{
+				threshold[i][0] |= (uint32_t)(bayer8x8[j][i]*2 + 1) << (8*j);
+				threshold[i][1] |= (uint32_t)(bayer8x8[j+4][i]*2 + 1) << (8*j);
+			}
+		}
+
+		for(int page = y0/8; page <= (y1-1)/8; page++)
+		{
+			const uint8_t* rows[8];
+			uint8_t mask = 0;
+
+			// rows outside the clip window read any valid row and are dropped by the mask
+			for(uint8_t j=0; j<8; j++)
+			{
+				int row = page*8 + j;
+
+				if((row >= y0) && (row < y1))
+				{
+					rows[j] = src_row[row];
+					mask |= 1 << j;
+				}
+				else rows[j] = src_row[y0];
+			}
+
+			for(int i=x0; i<x1; i++)
+			{
+				uint16_t c = src_col[i];
+				uint32_t top    = rows[0][c] | (rows[1][c] << 8) | (rows[2][c] << 16) | ((uint32_t)rows[3][c] << 24);
+				uint32_t bottom = rows[4][c] | (rows[5][c] << 8) | (rows[6][c] << 16) | ((uint32_t)rows[7][c] << 24);
+				uint8_t bits = thresholdLanes(top, threshold[i&7][0]) | (thresholdLanes(bottom, threshold[i&7][1]) << 4);
+
+				this->writePage(i, page, bits, mask);
+			}
+		}
+	}
+	else
+	{
+		// error for the next row, shifted by one so the pixel left of the first column has a slot
+		int16_t error[128 + 2] = { 0 };
+		uint8_t bits[128];
+
+		for(int j=y0; j<y1; j++)
+		{
+			int16_t right = 0;
+			int16_t below_right = 0;
+
+			if((j == y0) || ((j & 7) == 0)) memset(bits + x0, 0, x1 - x0);
+
+			for(int i=x0; i<x1; i++)
+			{
+				int16_t *e = error + (i - x0) + 1;
+				int16_t value = src_row[j][src_col[i]] + *e + right;
+				int16_t diff = value >= 128 ? value - 255 : value;
+
+				if(value >= 128) bits[i] |= 1 << (j & 7);
+
+				right  = diff * 7 / 16;
+				e[-1] += diff * 3 / 16;
+				e[0]   = diff * 5 / 16 + below_right;
+				below_right = diff / 16;
+			}
+
+			if(((j & 7) == 7) || (j == y1-1))
+			{
+				int first = (y0 > (j & ~7)) ? (y0 & 7) : 0;
+				uint8_t mask = (0xFF << first) & (0xFF >> (7 - (j & 7)));
+
+				for(int i=x0; i<x1; i++) this->writePage(i, j/8, bits[i], mask);
+			}
+		}
+	}
+}
+
+
 /**
  * @brief Set your own font
  *
@@ -6,8 +6,77 @@
 #include "SSD1306.hpp"
 #include "font.hpp"
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string>
 
+#define GFX_FIELD_MAX 21 // characters of the default font that fit in 128 columns
+
+
+enum class dither {
+	ORDERED,
+	FLOYD_STEINBERG
+};
+
+enum class align {
+	LEFT,
+	RIGHT
+};
+
+
+/**
+ * Fixed width text area remembering what is on the screen,
+ * so GFX redraws only the characters that changed.
+ */
+struct TextField {
+    TextField(int x, int y, uint8_t length, align alignment = align::RIGHT, colors color = colors::WHITE);
+    void reset();
+
+    int x;
+    int y;
+    uint8_t length;
+    align alignment;
+    colors color;
+    char glyphs[GFX_FIELD_MAX];
+};
+
+
+/**
+ * Bitmap with transparency mask, both page packed like the display buffer
+ * (width bytes per 8 rows, bit 0 is the top row).
+ * Copies shifted to every row offset within a page are made on first use,
+ * and the background under the sprite is kept to erase it.
+ */
+class Sprite {
+    friend class GFX;
+
+    protected:
+        const uint8_t* image;
+        const uint8_t* mask;
+        uint8_t width;
+        uint8_t height;
+
+        uint8_t* shifted[8];
+        uint8_t* saved;
+        int x;
+        int y;
+        bool visible;
+
+        uint8_t shiftedPages(uint8_t shift);
+        const uint8_t* getShifted(uint8_t shift);
+
+    public:
+        Sprite(const uint8_t* image, const uint8_t* mask, uint8_t width, uint8_t height);
+        ~Sprite();
+        Sprite(const Sprite&) = delete;
+        Sprite& operator=(const Sprite&) = delete;
+
+        bool collides(int x, int y, Sprite &other, int other_x, int other_y);
+        bool collides(Sprite &other);
+
+        int getX();
+        int getY();
+        bool isVisible();
+};
 
 
 class GFX : public SSD1306 {
@@ -17,13 +86,21 @@ class GFX : public SSD1306 {
         GFX(uint16_t const DevAddr, size Size, i2c_inst_t * i2c);
 
         void drawChar(int x, int y, char chr, colors color = colors::WHITE);
-        void drawString(int x, int y, std::string str, colors color = colors::WHITE);
+        void drawString(int x, int y, const char* str, colors color = colors::WHITE);
+        void drawString(int x, int y, const std::string &str, colors color = colors::WHITE);
+        void drawField(TextField &field, const char* text);
+        void drawNumber(TextField &field, int32_t value);
+        void drawFixed(TextField &field, int32_t value, uint8_t decimals);
+        void drawPrintf(TextField &field, const char* format, ...);
         void drawProgressBar(int x, int y, uint16_t w, uint16_t h, uint8_t progress, colors color = colors::WHITE);
         void drawFillRectangle(int x, int y, uint16_t w, uint16_t h, colors color = colors::WHITE);
         void drawRectangle(int x, int y, uint16_t w, uint16_t h, colors color = colors::WHITE);
         void drawHorizontalLine(int x, int y, int w, colors color = colors::WHITE);
         void drawVerticalLine(int x, int y, int w, colors color = colors::WHITE);
         void drawLine(int x_start, int y_start, int x_end, int y_end, colors color = colors::WHITE);
+        void drawSprite(Sprite &sprite, int x, int y);
+        void eraseSprite(Sprite &sprite);
+        void drawGrayImage(int x, int y, const uint8_t* image, uint16_t image_w, uint16_t image_h, uint16_t w = 0, uint16_t h = 0, dither mode = dither::ORDERED);
 
         void setFont(const uint8_t* font);
         const uint8_t* getFont();
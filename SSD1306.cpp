@@ -1,5 +1,59 @@
 #include "SSD1306.hpp"
 
+namespace {
+
+	inline static void extendRange(uint8_t *lo, uint8_t *hi, uint8_t page, uint8_t x0, uint8_t x1)
+	{
+		if(x0 < lo[page]) lo[page] = x0;
+		if(x1 > hi[page]) hi[page] = x1;
+	}
+
+	inline static void resetRange(uint8_t *lo, uint8_t *hi, uint8_t pages = 8)
+	{
+		memset(lo, 0xFF, pages);
+		memset(hi, 0x00, pages);
+	}
+
+	// Move bit i of a nibble to bit 2i+1, the odd buffer rows used by 128x32 panels
+	inline static uint8_t spreadNibble(uint8_t n)
+	{
+		return ((n & 1) << 1) | ((n & 2) << 2) | ((n & 4) << 3) | ((n & 8) << 4);
+	}
+
+	// Panel configuration sent one command per step(), settings kept by the driver follow in sendSettings()
+	const uint8_t init_sequence[] = {
+		SSD1306_DISPLAYOFF,
+		SSD1306_SETLOWCOLUMN,
+		SSD1306_SETHIGHCOLUMN,
+		SSD1306_SETSTARTLINE,
+		SSD1306_MEMORYMODE, 0x00,
+		SSD1306_SETMULTIPLEX, 0x3F,
+		SSD1306_SETDISPLAYOFFSET, 0x00,
+		SSD1306_SETDISPLAYCLOCKDIV, 0x80,
+		SSD1306_SETPRECHARGE, 0x22,
+		SSD1306_SETCOMPINS, 0x12,
+		SSD1306_SETVCOMDETECT, 0x40,
+		SSD1306_CHARGEPUMP, 0x14,
+		SSD1306_DISPLAYALLON_RESUME
+	};
+
+	// Inverse of spreadNibble, gather the odd bits of a buffer byte
+	inline static uint8_t packNibble(uint8_t b)
+	{
+		return ((b >> 1) & 1) | ((b >> 2) & 2) | ((b >> 3) & 4) | ((b >> 4) & 8);
+	}
+
+	// Copy bytes [from, to] rounded out to whole 32-bit words. Both buffers come from new[] so they are word aligned.
+	inline static void copyWords(unsigned char *dst, const unsigned char *src, uint16_t from, uint16_t to)
+	{
+		uint32_t *d = (uint32_t *)dst;
+		const uint32_t *s = (const uint32_t *)src;
+
+		for(uint16_t i = (from >> 2); i <= (to >> 2); i++) d[i] = s[i];
+	}
+
+};
+
 /*!
     @brief  Constructor for I2C-interfaced OLED display.
     @param  DevAddr
@@ -17,56 +71,96 @@ SSD1306::SSD1306(uint16_t const DevAddr, size Size, i2c_inst_t * i2c) : DevAddr(
 	this->width = 128;
 	this->height = 64;
 	
-	this->buffer = new unsigned char[this->width*this->height/8];
-	this->sendCommand(SSD1306_DISPLAYOFF);
-
-	this->sendCommand(SSD1306_SETLOWCOLUMN);
-	this->sendCommand(SSD1306_SETHIGHCOLUMN);
-	this->sendCommand(SSD1306_SETSTARTLINE);
-	this->sendCommand(SSD1306_MEMORYMODE);  
-	this->sendCommand(0x00);  
-	
-	this->setContrast(0xFF);
+	this->Status = status::INIT;
+	this->init_step = 0;
+	this->probe_time = get_absolute_time();
+	this->flush_pending = false;
+	this->settings_pending = false;
+	this->resync = false;
+	this->failures = 0;
+
+	this->window_columns = 128;
+	this->window_pages = 8;
+	this->max_chunk = 1024;
+	this->max_hold_us = 0;
+	this->bus_acquire = nullptr;
+	this->bus_release = nullptr;
+	this->bus_ctx = nullptr;
+
+	this->contrast = 0xFF;
+	this->rotation = 1;
+	this->inverted = 0;
+	this->on = 1;
 
-	this->rotateDisplay(1);
+	this->buffer = new unsigned char[this->width*this->height/8];
+	this->background = nullptr;
+	this->frame = new unsigned char[this->width*this->height/8];
+	resetRange(this->dirty_x0, this->dirty_x1);
+	resetRange(this->flush_x0, this->flush_x1);
+	resetRange(this->touched_x0, this->touched_x1);
 
-	this->sendCommand(SSD1306_NORMALDISPLAY);
+	// nothing is sent here, the panel is brought up by step() or by the first display()
+	this->clear();
+	this->displayAsync();
+}
 
-	this->sendCommand(0xA8);
-	this->sendCommand(0x3F);
 
-	this->sendCommand(SSD1306_SETDISPLAYOFFSET);
-	this->sendCommand(0x00);
+/*!
+    @brief  Deconstructor for I2C-interfaced OLED display.
+*/
+SSD1306::~SSD1306() 
+{
+	delete[] this->buffer;
+	delete[] this->background;
+	delete[] this->frame;
+}
 
-	this->sendCommand(SSD1306_SETDISPLAYCLOCKDIV);
-	this->sendCommand(0x80);
 
-	this->sendCommand(SSD1306_SETPRECHARGE);
-	this->sendCommand(0x22);
+/*!
+ * @brief Write one i2c transaction with timeout.
+ * There is no retry here: the panel may have taken part of a failed transfer,
+ * so the caller has to send the whole unit (address window and data) again.
+ * With setMaxBusHold() the timeout is cut to the time left for the current step().
+ * @return true on success
+ */
+bool SSD1306::write(const uint8_t* data, size_t len)
+{
+	uint32_t timeout = SSD1306_I2C_TIMEOUT_US + len * SSD1306_I2C_BYTE_US;
 
-	this->sendCommand(SSD1306_SETCOMPINS);
-	this->sendCommand(0x12);
-	
-	this->sendCommand(SSD1306_SETVCOMDETECT);	
-	this->sendCommand(0x40);
+	if(this->max_hold_us)
+	{
+		int64_t left = absolute_time_diff_us(get_absolute_time(), this->step_deadline);
 
-	this->sendCommand(SSD1306_CHARGEPUMP);
-	this->sendCommand(0x14);
+		if(left <= 0) left = 1;
+		if(left < timeout) timeout = left;
+	}
 
-	this->sendCommand(SSD1306_DISPLAYALLON_RESUME);
+	int ret = i2c_write_timeout_us(this->i2c, this->DevAddr, data, len, false, timeout);
+	if(ret == (int)len) return true;
 
-	this->displayON(1);
-	this->clear();
-	this->display();
+	this->resync = true;
+	return false;
 }
 
 
 /*!
-    @brief  Deconstructor for I2C-interfaced OLED display.
-*/
-SSD1306::~SSD1306() 
+ * @brief Send commands to display in one transaction.
+ * After a failed transfer the panel may still wait for arguments of a cut command,
+ * so two NOPs go first to complete it before the real commands.
+ */
+bool SSD1306::sendCommands(const uint8_t* commands, size_t len)
 {
-	delete this->buffer;
+	uint8_t nops = this->resync ? 2 : 0;
+	uint8_t mess[len+1+nops];
+
+	mess[0] = 0x00;
+	memset(mess+1, SSD1306_NOP, nops);
+	memcpy(mess+1+nops, commands, len);
+
+	if(!this->write(mess, sizeof(mess))) return false;
+
+	this->resync = false;
+	return true;
 }
 
 
@@ -74,10 +168,27 @@ SSD1306::~SSD1306()
  * @brief Send command to display.
  *
  */
-void SSD1306::sendCommand(uint8_t command)
+bool SSD1306::sendCommand(uint8_t command)
 {	
-	uint8_t mess[2] = {0x00, command};
-	i2c_write_blocking(this->i2c, this->DevAddr, mess, 2, false);
+	return this->sendCommands(&command, 1);
+}
+
+
+/*!
+ * @brief Send contrast, rotation, colors and on/off state kept by the driver.
+ *
+ */
+bool SSD1306::sendSettings()
+{
+	uint8_t commands[] = {
+		SSD1306_SETCONTRAST, this->contrast,
+		(uint8_t)(SSD1306_SEGREMAP | (0x01 & this->rotation)),	// 0xA0 => column Address 0 mapped to 127, 0xA1 => Column Address 127 mapped to 0
+		(uint8_t)(SSD1306_COMSCANINC | (0x08 & (this->rotation<<3))),	// 0xC0 => Scan from COM0 to COM[N-1], 0xC8 => Scan from COM[N-1] to COM0
+		(uint8_t)(this->inverted ? SSD1306_INVERTDISPLAY : SSD1306_NORMALDISPLAY),
+		(uint8_t)(this->on ? SSD1306_DISPLAYON : SSD1306_DISPLAYOFF)
+	};
+
+	return this->sendCommands(commands, sizeof(commands));
 }
 
 
@@ -87,7 +198,8 @@ void SSD1306::sendCommand(uint8_t command)
  */
 void SSD1306::invertColors(uint8_t Invert)
 {
-	this->sendCommand(Invert ? SSD1306_INVERTDISPLAY : SSD1306_NORMALDISPLAY);
+	this->inverted = Invert;
+	this->settings_pending = true;
 }
 
 
@@ -99,13 +211,8 @@ void SSD1306::rotateDisplay(uint8_t Rotate)
 {
 	if(Rotate > 1) Rotate = 1;
 
-	this->sendCommand(0xA0 | (0x01 & Rotate));  // Set Segment Re-Map Default
-							// 0xA0 (0x00) => column Address 0 mapped to 127
-                			// 0xA1 (0x01) => Column Address 127 mapped to 0
-
-	this->sendCommand(0xC0 | (0x08 & (Rotate<<3)));  // Set COM Output Scan Direction
-							// 0xC0	(0x00) => normal mode (RESET) Scan from COM0 to COM[N-1];Where N is the Multiplex ratio.
-							// 0xC8	(0xC8) => remapped mode. Scan from COM[N-1] to COM0;;Where N is the Multiplex ratio.
+	this->rotation = Rotate;
+	this->settings_pending = true;
 }
 
 
@@ -116,7 +223,8 @@ void SSD1306::rotateDisplay(uint8_t Rotate)
  */
 void SSD1306::displayON(uint8_t On)
 {
-	this->sendCommand(On ? SSD1306_DISPLAYON : SSD1306_DISPLAYOFF);
+	this->on = On;
+	this->settings_pending = true;
 }
 
 
@@ -126,8 +234,8 @@ void SSD1306::displayON(uint8_t On)
  */
 void SSD1306::setContrast(uint8_t Contrast)
 {
-	this->sendCommand(SSD1306_SETCONTRAST);
-	this->sendCommand(Contrast);
+	this->contrast = Contrast;
+	this->settings_pending = true;
 }
 
 
@@ -143,6 +251,8 @@ void SSD1306::drawPixel(int16_t x, int16_t y, colors Color)
 	if ((x < 0) || (x >= this->width) || (y < 0) || (y >= this->height)) return;
 	if(Size == size::W128xH32)  y = (y<<1) + 1;
 
+	this->markDirty(x, y/8, x, y/8);
+
 	switch(Color)
 	{
 		case colors::WHITE:   this->buffer[x+ (y/8) * this->width] |=  (1 << (y&7)); break;
@@ -152,6 +262,55 @@ void SSD1306::drawPixel(int16_t x, int16_t y, colors Color)
 }
 
 
+/*!
+ * @brief Write 8 vertical pixels at once.
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param page group of 8 rows from the top edge (0, MAX HEIGHT/8)
+ * @param bits pixel values, bit 0 is the top row
+ * @param mask rows to be written, other rows are left untouched
+ */
+void SSD1306::writePage(int16_t x, uint8_t page, uint8_t bits, uint8_t mask)
+{
+	if((x < 0) || (x >= this->width) || (page >= this->getHeight()/8) || (mask == 0)) return;
+
+	if(Size == size::W128xH32)
+	{
+		unsigned char *col = this->buffer + x + (page*2) * this->width;
+		uint8_t lo_mask = spreadNibble(mask & 0x0F);
+		uint8_t hi_mask = spreadNibble(mask >> 4);
+
+		col[0]           = (col[0] & ~lo_mask)           | (spreadNibble(bits & 0x0F) & lo_mask);
+		col[this->width] = (col[this->width] & ~hi_mask) | (spreadNibble(bits >> 4) & hi_mask);
+		this->markDirty(x, page*2, x, page*2 + 1);
+		return;
+	}
+
+	unsigned char *col = this->buffer + x + page * this->width;
+	*col = (*col & ~mask) | (bits & mask);
+	this->markDirty(x, page, x, page);
+}
+
+
+/*!
+ * @brief Read 8 vertical pixels at once.
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param page group of 8 rows from the top edge (0, MAX HEIGHT/8)
+ * @return pixel values, bit 0 is the top row, 0 outside the screen
+ */
+uint8_t SSD1306::readPage(int16_t x, uint8_t page)
+{
+	if((x < 0) || (x >= this->width) || (page >= this->getHeight()/8)) return 0;
+
+	if(Size == size::W128xH32)
+	{
+		const unsigned char *col = this->buffer + x + (page*2) * this->width;
+		return packNibble(col[0]) | (packNibble(col[this->width]) << 4);
+	}
+
+	return this->buffer[x + page * this->width];
+}
+
+
 /*!
  * @brief Clear the buffer.
  * @param color colors::BLACK, colors::WHITE or colors::INVERSE
@@ -167,34 +326,428 @@ void SSD1306::clear(colors Color)
 			memset(buffer, 0x00, (this->height * this->width / 8));
 			break;
 	}
+
+	this->markDirty(0, 0, this->width-1, this->height/8 - 1);
+}
+
+
+/*!
+ * @brief Do one step of the display work, at most two i2c transactions with one attempt each.
+ * Call it from the main loop: it initializes the panel, reconnects it after
+ * SSD1306_RETRY_MS when it stops answering, sends changed settings and one window of a flush started with displayAsync().
+ * After a reconnection the settings and the last frame are sent again.
+ * An idle panel gets a NOP every SSD1306_RETRY_MS, so unplugging it is noticed without flushing;
+ * a panel unplugged and plugged back between two checks is not noticed.
+ * Each step holds the bus only between the arbiter acquire and release calls,
+ * and with setMaxBusHold() its transfers are cut off when the limit is reached.
+ * @return true when the panel is ready and nothing is left to send
+ */
+bool SSD1306::step()
+{
+	if(this->Status == status::OFFLINE)
+	{
+		if(time_reached(this->retry_time))
+		{
+			this->Status = status::INIT;
+			this->init_step = 0;
+		}
+		return false;
+	}
+
+	bool idle = (this->Status == status::READY) && !this->settings_pending && !this->flush_pending;
+
+	// a failed check is repeated at once, so a missing panel goes offline without waiting
+	if(idle && !this->failures && !time_reached(this->probe_time)) return true;
+	if((this->bus_acquire != nullptr) && !this->bus_acquire(this->bus_ctx)) return false;
+	if(this->max_hold_us) this->step_deadline = make_timeout_time_us(this->max_hold_us);
+
+	bool ok;
+
+	if(this->Status == status::INIT)
+	{
+		if(this->init_step < sizeof(init_sequence))
+		{
+			ok = this->sendCommand(init_sequence[this->init_step]);
+			if(ok) this->init_step++;
+		}
+		else if((ok = this->sendSettings()))
+		{
+			// panel memory is unknown after power up
+			this->Status = status::READY;
+			this->settings_pending = false;
+			memset(this->flush_x0, 0x00, 8);
+			memset(this->flush_x1, this->width-1, 8);
+			this->flush_pending = true;
+		}
+	}
+	else if(this->settings_pending)
+	{
+		ok = this->sendSettings();
+		if(ok) this->settings_pending = false;
+	}
+	else if(idle) ok = this->sendCommand(SSD1306_NOP);
+	else ok = this->sendWindow();
+
+	if(this->bus_release != nullptr) this->bus_release(this->bus_ctx);
+
+	// a panel that stops answering during initialization or for several steps in a row is
+	// initialized again, a single error only repeats the failed step and keeps the flush state
+	if(ok)
+	{
+		this->failures = 0;
+		this->probe_time = make_timeout_time_ms(SSD1306_RETRY_MS);
+	}
+	else if((this->Status == status::INIT) || (++this->failures >= SSD1306_MAX_FAILURES))
+	{
+		this->Status = status::OFFLINE;
+		this->failures = 0;
+		this->retry_time = make_timeout_time_ms(SSD1306_RETRY_MS);
+	}
+
+	return false;
+}
+
+
+/*!
+ * @brief Send the next window of the frame, limited by setFlushWindow() and setMaxBusHold().
+ * Columns stay pending until the address window and the data are both sent,
+ * a failed window is sent again as a whole by the next step().
+ * @return false when the transfer failed
+ */
+bool SSD1306::sendWindow()
+{
+	uint8_t first = 0;
+
+	while((first < this->height/8) && (this->flush_x0[first] > this->flush_x1[first])) first++;
+
+	if(first == this->height/8)
+	{
+		this->flush_pending = false;
+		return true;
+	}
+
+	uint8_t columns = this->window_columns < this->max_chunk ? this->window_columns : this->max_chunk;
+	uint8_t x0 = this->flush_x0[first];
+	uint8_t x1 = this->flush_x1[first] - x0 < columns ? this->flush_x1[first] : x0 + columns - 1;
+	uint8_t w = x1 - x0 + 1;
+	uint8_t pages = this->max_chunk / w < this->window_pages ? this->max_chunk / w : this->window_pages;
+	uint8_t last = first;
+
+	// take the following pages while the part left of each of them stays one range
+	while((last + 1 < this->height/8) && (last + 1 - first < pages))
+	{
+		uint8_t lo = this->flush_x0[last + 1];
+		uint8_t hi = this->flush_x1[last + 1];
+
+		if((lo > hi) || (lo > x1) || (hi < x0) || ((lo < x0) && (hi > x1))) break;
+		last++;
+	}
+
+	uint8_t window[] = {SSD1306_COLUMNADDR, x0, x1, SSD1306_PAGEADDR, first, last};
+	uint8_t mess[1 + w * (last - first + 1)];
+
+	mess[0] = 0x40;
+	for(uint8_t page = first; page <= last; page++)
+	{
+		memcpy(mess + 1 + (page - first) * w, this->frame + page * this->width + x0, w);
+	}
+
+	if(!this->sendCommands(window, sizeof(window))) return false;
+	if(!this->write(mess, sizeof(mess))) return false;
+
+	for(uint8_t page = first; page <= last; page++)
+	{
+		if(this->flush_x0[page] >= x0)
+		{
+			if(this->flush_x1[page] > x1) this->flush_x0[page] = x1 + 1;
+			else resetRange(this->flush_x0 + page, this->flush_x1 + page, 1);
+		}
+		else this->flush_x1[page] = x0 - 1;
+	}
+
+	return true;
+}
+
+
+/*!
+ * @brief Bring the panel up, blocking for at most one initialization.
+ * @return true when the panel is ready
+ */
+bool SSD1306::connect()
+{
+	if(this->Status == status::OFFLINE) this->retry_time = get_absolute_time();
+
+	while(this->Status != status::READY)
+	{
+		this->step();
+		if(this->Status == status::OFFLINE) return false;
+	}
+
+	return true;
+}
+
+
+/*!
+ * @brief Finish sending the frame started before, blocking.
+ * @return false when the panel does not answer
+ */
+bool SSD1306::flush()
+{
+	if(!this->connect()) return false;
+
+	while(!this->step())
+	{
+		if(this->Status != status::READY) return false;
+	}
+
+	return true;
 }
 
 
 /*!
  * @brief Send buffer to OLED GCRAM.
  * @param data (Optional) Pointer to data array.
+ * @return false when the panel does not answer
  */
-void SSD1306::display(unsigned char *data)
+bool SSD1306::display(unsigned char *data)
 {
-	if(data == nullptr) data = this->buffer;
-	this->sendCommand(0x22);
-	this->sendCommand(0x00);
-	this->sendCommand(0x07);
-	this->sendData(data, this->width*this->height/8);
+	if(data == nullptr)
+	{
+		this->invalidate();
+		return this->displayDirty();
+	}
+
+	if(!this->flush()) return false;
+
+	memcpy(this->frame, data, this->width*this->height/8);
+	memset(this->flush_x0, 0x00, 8);
+	memset(this->flush_x1, this->width-1, 8);
+	this->flush_pending = true;
+
+	// the panel no longer shows our buffer, the next update has to resend everything
+	this->invalidate();
+
+	return this->flush();
 }
 
 
-void SSD1306::sendData(uint8_t* buffer, size_t buff_size)
+/*!
+ * @brief Send only the parts of the buffer changed since the last flush.
+ * Changed columns are sent as windows, so a few changed digits cost a few bytes instead of the whole frame.
+ * A frame still being sent by step() is finished first.
+ * @return false when the panel does not answer
+ */
+bool SSD1306::displayDirty()
+{
+	if(!this->flush()) return false;
+
+	this->displayAsync();
+	return this->flush();
+}
+
+
+/*!
+ * @brief Start sending the parts of the buffer changed since the last flush without blocking.
+ * The changed parts are copied aside, so the next frame can be drawn while step() sends this one.
+ * Nothing is started while the previous frame is still being sent, the changes are kept
+ * for a later call: call it again once step() returns true.
+ * @return true when the frame was started
+ */
+bool SSD1306::displayAsync()
+{
+	if(this->flush_pending) return false;
+
+	for(uint8_t page = 0; page < this->height/8; page++)
+	{
+		if(this->dirty_x0[page] > this->dirty_x1[page]) continue;
+
+		uint16_t offset = page * this->width;
+		copyWords(this->frame, this->buffer, offset + this->dirty_x0[page], offset + this->dirty_x1[page]);
+		extendRange(this->flush_x0, this->flush_x1, page, this->dirty_x0[page], this->dirty_x1[page]);
+		this->flush_pending = true;
+	}
+
+	resetRange(this->dirty_x0, this->dirty_x1);
+	return true;
+}
+
+
+/*!
+ * @brief Return state of the connection with the panel.
+ * @return status::OFFLINE, status::INIT or status::READY
+ */
+status SSD1306::getStatus()
+{
+	return this->Status;
+}
+
+
+/*!
+ * @brief Split flushes into windows of at most columns x pages (8 rows each).
+ * Smaller windows keep each step() short on a bus shared with other devices.
+ * @param columns window width (1, 128)
+ * @param pages window height (1, 8)
+ */
+void SSD1306::setFlushWindow(uint8_t columns, uint8_t pages)
+{
+	this->window_columns = columns < 1 ? 1 : (columns > this->width ? this->width : columns);
+	this->window_pages = pages < 1 ? 1 : (pages > this->height/8 ? this->height/8 : pages);
+}
+
+
+/*!
+ * @brief Limit how long one step() holds the bus, on top of setFlushWindow().
+ * Windows are sized to fit in the limit at 9 clocks per byte, including the window addressing
+ * and i2c overhead, and transfers still running at the limit (e.g. on errors) are cut off.
+ * A limit too short for the addressing and one column is raised to that minimum
+ * (about 1.5 ms at 100 kHz, 360 us at 400 kHz), as shorter windows could never be sent.
+ * @param us maximum bus hold time in microseconds, 0 removes the limit
+ * @param baudrate i2c clock, as returned by i2c_init()
+ * @return limit in use in microseconds, 0 when there is none
+ */
+uint32_t SSD1306::setMaxBusHold(uint32_t us, uint32_t baudrate)
+{
+	// window command (7 bytes) after up to two resync NOPs, data control byte, two address bytes,
+	// start/stop conditions and one byte of margin for clock stretching
+	const uint32_t overhead = 15;
+
+	if((us == 0) || (baudrate == 0))
+	{
+		this->max_hold_us = 0;
+		this->max_chunk = 1024;
+		return 0;
+	}
+
+	uint32_t min_us = ((overhead + 1) * 9 * 1000000 + baudrate - 1) / baudrate;
+	if(us < min_us) us = min_us;
+
+	uint32_t bytes = (uint64_t)us * baudrate / 9 / 1000000;
+
+	this->max_hold_us = us;
+	this->max_chunk = bytes - overhead > 1024 ? 1024 : bytes - overhead;
+	return us;
+}
+
+
+/*!
+ * @brief Set functions that take and give back a bus shared with other devices.
+ * step() calls acquire before talking to the panel and does nothing if it returns false,
+ * then calls release when the transfer is done.
+ * @param acquire returns true when the bus may be used now
+ * @param release called after the transfer
+ * @param ctx passed to both functions
+ */
+void SSD1306::setBusArbiter(bool (*acquire)(void *ctx), void (*release)(void *ctx), void *ctx)
+{
+	this->bus_acquire = acquire;
+	this->bus_release = release;
+	this->bus_ctx = ctx;
+}
+
+
+/*!
+ * @brief Mark the whole buffer as not sent.
+ */
+void SSD1306::invalidate()
+{
+	memset(this->dirty_x0, 0x00, 8);
+	memset(this->dirty_x1, this->width-1, 8);
+}
+
+
+/*!
+ * @brief Mark a block of the buffer as changed.
+ * @param x0 first column
+ * @param page0 first page (8 rows of the buffer)
+ * @param x1 last column
+ * @param page1 last page
+ */
+void SSD1306::markDirty(int16_t x0, uint8_t page0, int16_t x1, uint8_t page1)
+{
+	if(x0 < 0) x0 = 0;
+	if(x1 >= this->width) x1 = this->width-1;
+	if(page1 >= this->height/8) page1 = this->height/8 - 1;
+	if(x0 > x1) return;
+
+	for(uint8_t page = page0; page <= page1; page++)
+	{
+		extendRange(this->dirty_x0, this->dirty_x1, page, x0, x1);
+		extendRange(this->touched_x0, this->touched_x1, page, x0, x1);
+	}
+}
+
+
+/*!
+ * @brief Keep the current buffer as the static background layer.
+ * Draw labels, frames and icons once, call saveBackground(), then every frame
+ * call restoreBackground() and draw only the values that change.
+ */
+void SSD1306::saveBackground()
+{
+	uint16_t buff_size = this->width*this->height/8;
+
+	if(this->background == nullptr) this->background = new unsigned char[buff_size];
+	copyWords(this->background, this->buffer, 0, buff_size-1);
+	resetRange(this->touched_x0, this->touched_x1);
+}
+
+
+/*!
+ * @brief Copy a rectangle of the buffer into the background layer, restoreBackground() then keeps it.
+ * @param x position from the left edge (0, MAX WIDTH)
+ * @param y position from the top edge (0, MAX HEIGHT)
+ * @param w width of the rectangle
+ * @param h height of the rectangle
+ */
+void SSD1306::keepInBackground(int16_t x, int16_t y, uint16_t w, uint16_t h)
+{
+	if(this->background == nullptr) return;
+
+	for(int16_t j = (y < 0 ? 0 : y); (j < y + h) && (j < this->getHeight()); j++)
+	{
+		int16_t row = Size == size::W128xH32 ? (j<<1) + 1 : j;
+		uint8_t bit = 1 << (row & 7);
+
+		for(int16_t i = (x < 0 ? 0 : x); (i < x + w) && (i < this->width); i++)
+		{
+			uint16_t index = i + (row/8) * this->width;
+			this->background[index] = (this->background[index] & ~bit) | (this->buffer[index] & bit);
+		}
+	}
+}
+
+
+/*!
+ * @brief Put the background layer back under everything drawn since the previous restore.
+ * Only those regions are copied and marked dirty, so displayDirty() sends the old and new overlay only.
+ */
+void SSD1306::restoreBackground()
+{
+	if(this->background == nullptr) return;
+
+	for(uint8_t page = 0; page < this->height/8; page++)
+	{
+		if(this->touched_x0[page] > this->touched_x1[page]) continue;
+
+		uint16_t offset = page * this->width;
+		copyWords(this->buffer, this->background, offset + this->touched_x0[page], offset + this->touched_x1[page]);
+		extendRange(this->dirty_x0, this->dirty_x1, page, this->touched_x0[page], this->touched_x1[page]);
+	}
+
+	resetRange(this->touched_x0, this->touched_x1);
+}
+
+
+bool SSD1306::sendData(const uint8_t* buffer, size_t buff_size)
 {
 	unsigned char mess[buff_size+1];
 
 	mess[0] = 0x40;
 	memcpy(mess+1, buffer, buff_size);
 
-	i2c_write_blocking(this->i2c, this->DevAddr, mess, buff_size+1, false);
+	return this->write(mess, buff_size+1);
 }
 
-
 /*!
  * @brief Return display height.
  * @return display height
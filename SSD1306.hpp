@@ -1,6 +1,7 @@
 #pragma once
 
 #include "hardware/i2c.h"
+#include "pico/time.h"
 #include "string.h"
 #include "stdint.h"
 
@@ -30,6 +31,12 @@
 #define SSD1306_CHARGEPUMP 0x8D
 #define SSD1306_EXTERNALVCC 0x1
 #define SSD1306_SWITCHCAPVCC 0x2
+#define SSD1306_NOP 0xE3
+
+#define SSD1306_I2C_TIMEOUT_US 1000		// base timeout of one i2c transaction
+#define SSD1306_I2C_BYTE_US 100			// added per byte, enough for a 100 kHz bus
+#define SSD1306_RETRY_MS 500			// delay between reconnection attempts and between checks of an idle panel
+#define SSD1306_MAX_FAILURES 2			// failed steps in a row before the panel is initialized again
 
 
 enum class colors {
@@ -43,6 +50,12 @@ enum class size {
 	W128xH32
 };
 
+enum class status {
+	OFFLINE,
+	INIT,
+	READY
+};
+
 
 class SSD1306 {
 	protected:
@@ -51,11 +64,51 @@ class SSD1306 {
 		uint8_t width;
 		uint8_t height;
 		size Size;
+		status Status;
+
+		uint8_t init_step;
+		absolute_time_t retry_time;
+		absolute_time_t probe_time;
+		bool flush_pending;
+		bool settings_pending;
+		bool resync;
+		uint8_t failures;
+
+		uint8_t window_columns;
+		uint8_t window_pages;
+		uint16_t max_chunk;
+		uint32_t max_hold_us;
+		absolute_time_t step_deadline;
+		bool (*bus_acquire)(void *ctx);
+		void (*bus_release)(void *ctx);
+		void * bus_ctx;
+
+		uint8_t contrast;
+		uint8_t rotation;
+		uint8_t inverted;
+		uint8_t on;
 		
 		unsigned char * buffer;
+		unsigned char * background;
+		unsigned char * frame;					// copy of the buffer being sent to the panel
+
+		uint8_t dirty_x0[8], dirty_x1[8];		// columns changed since the last displayAsync(), per page
+		uint8_t flush_x0[8], flush_x1[8];		// columns of the frame still to be sent, per page
+		uint8_t touched_x0[8], touched_x1[8];	// columns drawn since the last background restore, per page
 
-		void sendData(uint8_t* buffer, size_t buff_size);
-		void sendCommand(uint8_t command);
+		bool write(const uint8_t* data, size_t len);
+		bool sendData(const uint8_t* buffer, size_t buff_size);
+		bool sendCommands(const uint8_t* commands, size_t len);
+		bool sendCommand(uint8_t command);
+		bool sendSettings();
+		bool sendWindow();
+		bool connect();
+		bool flush();
+		void invalidate();
+		void markDirty(int16_t x0, uint8_t page0, int16_t x1, uint8_t page1);
+		void writePage(int16_t x, uint8_t page, uint8_t bits, uint8_t mask);
+		uint8_t readPage(int16_t x, uint8_t page);
+		void keepInBackground(int16_t x, int16_t y, uint16_t w, uint16_t h);
 
 	public:
 		SSD1306(uint16_t const DevAddr, size Size, i2c_inst_t * i2c);
@@ -68,7 +121,19 @@ class SSD1306 {
 
 		void drawPixel(int16_t x, int16_t y, colors Color = colors::WHITE);
 		void clear(colors Color = colors::BLACK);
-		void display(unsigned char *data = nullptr);
+		bool display(unsigned char *data = nullptr);
+		bool displayDirty();
+		bool displayAsync();
+
+		bool step();
+		status getStatus();
+		void setFlushWindow(uint8_t columns, uint8_t pages);
+		uint32_t setMaxBusHold(uint32_t us, uint32_t baudrate);
+		void setBusArbiter(bool (*acquire)(void *ctx), void (*release)(void *ctx), void *ctx = nullptr);
+
+		void saveBackground();
+		void restoreBackground();
+
 		uint8_t getHeight();
 		uint8_t getWidth();
 };
\ No newline at end of file
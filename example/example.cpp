@@ -19,17 +19,27 @@ int main() {
     // if you are using 128x32 oled try size::W128xH32
 
     oled.display(logo);                     //Display bitmap
-    
+    sleep_ms(1000);
+
+    oled.clear();                           //Clear buffer
+    oled.drawString(0, 0, "Raspberry Pico");
+    oled.drawString(0, 10, "Oled Example");
+    oled.drawString(0, 20, "Have fun!");
+    oled.saveBackground();                  //Keep the static text as background layer
+    oled.display();                         //Send buffer to the screen
+
+    TextField value(oled.getWidth()-24, 20, 4);   //4 chars, right aligned, next to the static text
+
     while(true) 
     {
         sleep_ms(1000);
-        oled.clear();                       //Clear buffer
-        oled.drawString(0, 0, "Raspberry Pico");
-        oled.drawString(0, 10, "Oled Example");
-        oled.drawString(0, 20, "Have fun!");
-        oled.drawProgressBar(0, oled.getHeight()-5, oled.getWidth(), 5, rand() % 100 + 1);
+        uint8_t progress = rand() % 100 + 1;
+
+        oled.restoreBackground();           //Erase only what was drawn over the background
+        oled.drawProgressBar(0, oled.getHeight()-5, oled.getWidth(), 5, progress);
+        oled.drawPrintf(value, "%d%%", progress);   //Repaints only the changed characters, kept across restoreBackground()
 
-        oled.display();                     //Send buffer to the screen
+        oled.displayDirty();                //Send only the changed part of the buffer
     }
     return 0;
 }
\ No newline at end of file